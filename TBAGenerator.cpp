@@ -3,6 +3,7 @@
 #include "./containers/Map.h"            // Make associated hash table class Map available
 
 #include "./util/Message.h"        // Make message handlers available, not used in this example
+#include "./util/LineFile.h"       // Make file id -> file name lookup available
 
 #include "./verilog/veri_file.h"      // Make Verilog reader available
 
@@ -19,6 +20,7 @@
 #include <string.h>
 #include <vector>
 #include <queue>
+#include <ctime>
 #include "support_funcs.h"
 
 #ifdef VERIFIC_NAMESPACE
@@ -39,10 +41,37 @@ struct Clock {
     int period;
 };
 
+// One input file an output depends on. Size and mtime let an unchanged file be
+// recognized without reading it; the hash is only checked when they differ.
+// mtime has a resolution of one second, so a file modified in the current second
+// gets mtime -1 and is hashed on the next run, as it may still change unnoticed.
+struct DepFile {
+    std::string kind;   // "design" (top file and everything it `includes) or "vectors"
+    std::string path;
+    long long size = -1;
+    long long mtime = -1;
+    std::string hash;   // "-" if the file could not be read
+};
+
+// Everything an output depends on, stored next to it in <output>.deps
+struct DepManifest {
+    std::vector<DepFile> files;
+    std::string clocks;
+    std::string options;
+};
+
+// Bump when the layout of the generated files changes, so old manifests are invalidated
+#define TB_FORMAT_VERSION "3"
+
 extern std::string checkAndReturnBusDimension(char *busName);
 std::vector<Clock> extractClocksList(std::string);
 int getTestVectors(std::string fileName,std::vector<Port> &portList);
 int getBusSize(Port bus);
+DepFile recordDepFile(std::string kind, std::string path);
+int readManifest(std::string fileName, DepManifest &manifest);
+std::string manifestToString(const DepManifest &manifest);
+bool manifestIsUpToDate(DepManifest &manifest, bool &refreshed);
+std::string replaceExtension(std::string fileName, std::string ext);
 
 
 int main(int argc, char **argv)
@@ -57,6 +86,8 @@ int main(int argc, char **argv)
     const char *file_name = 0 ;
     std::string clksString;
     std::vector<Clock> allClocksList;
+    bool useMemFile = false;
+    bool forceRegen = false;
 
     for (int i = 1; i < argc; i++) {
         if (Strings::compare(argv[i], "-o")) {
@@ -81,6 +112,12 @@ int main(int argc, char **argv)
             i++ ;
             tv_file = (i < argc) ? argv[i]: 0 ;
             continue ;
+        } else if (Strings::compare(argv[i], "-mem")) {
+            useMemFile = true;
+            continue ;
+        } else if (Strings::compare(argv[i], "-force")) {
+            forceRegen = true;
+            continue ;
         }
     }
     if(argc==1)
@@ -91,6 +128,8 @@ int main(int argc, char **argv)
         Message::PrintLine("         -clks {list of clocks} <input ports defined as clocks and periods in ns>\n") ;
         Message::PrintLine("            Example -clks {clk1 nanosec1,clk2 nanosec2...}\n") ;
         Message::PrintLine("         -testvec <Input testvectors file> \n") ;
+        Message::PrintLine("         -mem    write test vectors to a .mem side file read by the tb\n") ;
+        Message::PrintLine("         -force  regenerate even if the dependency manifest is up to date\n") ;
         return 1 ;
     }
 
@@ -99,10 +138,57 @@ int main(int argc, char **argv)
         return 1 ;
     }
 
+    std::string outFileName = file_name ? file_name : "exportTB.v";
+    std::string memFileName = replaceExtension(outFileName, ".mem");
+    std::string depsFileName = outFileName + ".deps";
+
+    //--------------------------------------------------------------
+    // CHECK DEPENDENCY MANIFEST
+    //--------------------------------------------------------------
+    // Only the size and mtime of each recorded input are looked at here, files are
+    // hashed only when those changed, so a no-op run does not depend on the input size.
+    std::string options = std::string("format=") + TB_FORMAT_VERSION + ";in=" + file_nm + ";tv=" + tv_file +
+            ";out=" + outFileName + ";mem=" + (useMemFile ? "1" : "0");
+    DepManifest curManifest;
+    curManifest.clocks = hashToHex(hashString(clksString));
+    curManifest.options = hashToHex(hashString(options));
+    DepManifest oldManifest;
+    bool refreshed = false;
+    if(!forceRegen && !readManifest(depsFileName, oldManifest) &&
+            oldManifest.clocks == curManifest.clocks && oldManifest.options == curManifest.options &&
+            manifestIsUpToDate(oldManifest, refreshed)) {
+        FILE *pOut = fopen(outFileName.c_str(),"r");
+        FILE *pMem = useMemFile ? fopen(memFileName.c_str(),"r") : 0;
+        bool outputsExist = pOut && (!useMemFile || pMem);
+        if(pOut) fclose(pOut);
+        if(pMem) fclose(pMem);
+        if(outputsExist) {
+            // inputs were touched but not changed: store the new mtimes to keep the next run cheap
+            if(refreshed)
+                writeFileIfChanged(depsFileName.c_str(), manifestToString(oldManifest));
+            printf("%s is up to date\n", outFileName.c_str());
+            return 0;
+        }
+    }
+
     allClocksList = extractClocksList(clksString);
 
     if (!veri_file::Analyze(file_nm.c_str(), veri_file::SYSTEM_VERILOG)) return 2 ;
 
+    // Record every file the parser opened (the top file and all `included files).
+    // File id 0 is reserved, ids are handed out in increasing order.
+    bool topFileRecorded = false;
+    const char *dep_file_name ;
+    for (unsigned file_id = 1; (dep_file_name = LineFile::GetFileNameFromId(file_id)) != 0; ++file_id) {
+        curManifest.files.push_back(recordDepFile("design", dep_file_name));
+        if(file_nm == dep_file_name)
+            topFileRecorded = true;
+    }
+    if(!topFileRecorded)
+        curManifest.files.push_back(recordDepFile("design", file_nm));
+    if(!tv_file.empty())
+        curManifest.files.push_back(recordDepFile("vectors", tv_file));
+
     // Get the list of top modules
     Array *top_mod_array = veri_file::GetTopModules() ;
     if (!top_mod_array) {
@@ -377,17 +463,14 @@ int main(int argc, char **argv)
 
     getTestVectors(tv_file,allPortList);
 
-    FILE * pTBFile;
-    if(!file_name)
-        pTBFile = fopen ("exportTB.v","w");
-    else {
-        pTBFile = fopen (file_name,"w");
-    }
-    if(!pTBFile)
-    {
-        printf("Error in export file open\n") ;
-        return 1;
+    // Width of one row of the .mem file: all non-clock ports, MSB first
+    int vecWidth = 0;
+    for (std::vector<Port>::iterator it = allPortList.begin() ; it != allPortList.end(); ++it) {
+        if(!(*it).isClock)
+            vecWidth += (*it).bus_size.empty() ? 1 : getBusSize(*it);
     }
+    if(vecWidth < 1)
+        vecWidth = 1;
 
     tbFileString = "`timescale 1 ns /  100 ps\n";
     tbFileString =tbFileString + "module " + topModule + ";\n";
@@ -397,6 +480,12 @@ int main(int argc, char **argv)
         else
             tbFileString = tbFileString+ (*it).type +"  " +(*it).bus_size +" " + (*it).name + "; \n";
     }
+    if(useMemFile) {
+        tbFileString = tbFileString + "integer tb_vec_fd; \n";
+        tbFileString = tbFileString + "integer tb_vec_rc; \n";
+        tbFileString = tbFileString + "reg  [" + std::to_string(vecWidth-1) + ":0] tb_vec; \n";
+        tbFileString = tbFileString + "reg  [8*256-1:0] tb_vec_file; \n";
+    }
     tbFileString = tbFileString + "\n\n";
 
     tbFileString = tbFileString + "initial\n   begin\n";
@@ -407,7 +496,7 @@ int main(int argc, char **argv)
     }
     tbFileString = tbFileString +"\");\n";
 
-    std::string percSign = "%%";
+    std::string percSign = "%";
     tbFileString = tbFileString + "  $monitor(\"" +percSign+"d,\\t\%b,";
     for (int i =1; i<(int)allPortList.size() ; ++i) {
         tbFileString = tbFileString + "  \\t\%b,";
@@ -431,38 +520,102 @@ int main(int argc, char **argv)
         if((*it).direction !="output")
             tbFileString = tbFileString+"   " +(*it).name +" =0;\n";
     }
-    bool vecQueueIsEmpty = false;
-    do {
+    std::string memFileString;
+    if(useMemFile) {
+        // The vectors live in the .mem side file, so the tb itself only depends on the
+        // interface and is left untouched when just the vectors change.
+        // $fopen resolves paths against the simulator's working directory, so only the
+        // basename is emitted; +TB_MEM=<path> overrides it at simulation time.
+        std::string memBaseName = memFileName;
+        size_t sep = memBaseName.find_last_of("/\\");
+        if(sep != std::string::npos)
+            memBaseName = memBaseName.substr(sep+1);
+        tbFileString = tbFileString + "   if (!$value$plusargs(\"TB_MEM=%s\", tb_vec_file))\n";
+        tbFileString = tbFileString + "      tb_vec_file = \"" + memBaseName + "\";\n";
+        tbFileString = tbFileString + "   tb_vec_fd = $fopen(tb_vec_file, \"r\");\n";
+        tbFileString = tbFileString + "   if (tb_vec_fd == 0) begin\n";
+        tbFileString = tbFileString + "      $display(\"ERROR: cannot open test vectors file %0s\", tb_vec_file);\n";
+        tbFileString = tbFileString + "      $finish(2);\n";
+        tbFileString = tbFileString + "   end\n";
+        tbFileString = tbFileString + "   else begin\n";
+        tbFileString = tbFileString + "      while (!$feof(tb_vec_fd)) begin\n";
+        tbFileString = tbFileString + "         tb_vec_rc = $fscanf(tb_vec_fd, \"%b\\n\", tb_vec);\n";
+        tbFileString = tbFileString + "         if (tb_vec_rc == 1) begin\n";
+        int msb = vecWidth-1;
         for (std::vector<Port>::iterator it = allPortList.begin() ; it != allPortList.end(); ++it) {
-            // note that ports with direction of type OUTPUT are not supposed to have assigned values!
-            // enabled it here if you have VPI procedures and need to check the outputs from the HDL simulators with these values from test-vec files!
-            if(/*(*it).direction !="output" &&*/ !(*it).isClock)  {
-
-                if(!(*it).bus_size.empty()) {
-                    std::string busVector;
-                    int busSize = getBusSize(*it);
-                    if((*it).test_queue.empty())
+            if((*it).isClock)
+                continue;
+            if(!(*it).bus_size.empty()) {
+                int busSize = getBusSize(*it);
+                tbFileString = tbFileString+"#10   " +(*it).name +" =tb_vec[" + std::to_string(msb) + ":" + std::to_string(msb-busSize+1) + "];\n";
+                msb -= busSize;
+            } else {
+                tbFileString = tbFileString+"#10   " +(*it).name +" =tb_vec[" + std::to_string(msb) + "];\n";
+                --msb;
+            }
+        }
+        tbFileString = tbFileString + "         end\n";
+        tbFileString = tbFileString + "      end\n";
+        tbFileString = tbFileString + "      $fclose(tb_vec_fd);\n";
+        tbFileString = tbFileString + "   end\n";
+
+        bool vecQueueIsEmpty = false;
+        do {
+            std::string vecRow;
+            for (std::vector<Port>::iterator it = allPortList.begin() ; it != allPortList.end(); ++it) {
+                if((*it).isClock)
+                    continue;
+                int busSize = (*it).bus_size.empty() ? 1 : getBusSize(*it);
+                for(;busSize>0;--busSize) {
+                    if((*it).test_queue.empty()) {
+                        // keep every row the same width
+                        vecRow += 'x';
+                        vecQueueIsEmpty = true;
                         continue;
-                    for(busSize;busSize>0;--busSize) {
-                        busVector+= (*it).test_queue.front();
-                        (*it).test_queue.pop();
-                        if((*it).test_queue.empty())
-                            vecQueueIsEmpty = true;
                     }
-                    tbFileString = tbFileString+"#10   " +(*it).name +" =" +std::to_string(getBusSize(*it))+"'b"+ busVector+";\n";
-                } else {
-
-
-                    tbFileString = tbFileString+"#10   " +(*it).name +" =" + (*it).test_queue.front()+";\n";
+                    vecRow += (*it).test_queue.front();
                     (*it).test_queue.pop();
                     if((*it).test_queue.empty())
                         vecQueueIsEmpty = true;
                 }
+            }
+            memFileString = memFileString + vecRow + "\n";
+        }
+        while(!vecQueueIsEmpty);
+    } else {
+        bool vecQueueIsEmpty = false;
+        do {
+            for (std::vector<Port>::iterator it = allPortList.begin() ; it != allPortList.end(); ++it) {
+                // note that ports with direction of type OUTPUT are not supposed to have assigned values!
+                // enabled it here if you have VPI procedures and need to check the outputs from the HDL simulators with these values from test-vec files!
+                if(/*(*it).direction !="output" &&*/ !(*it).isClock)  {
+
+                    if(!(*it).bus_size.empty()) {
+                        std::string busVector;
+                        int busSize = getBusSize(*it);
+                        if((*it).test_queue.empty())
+                            continue;
+                        for(busSize;busSize>0;--busSize) {
+                            busVector+= (*it).test_queue.front();
+                            (*it).test_queue.pop();
+                            if((*it).test_queue.empty())
+                                vecQueueIsEmpty = true;
+                        }
+                        tbFileString = tbFileString+"#10   " +(*it).name +" =" +std::to_string(getBusSize(*it))+"'b"+ busVector+";\n";
+                    } else {
 
+
+                        tbFileString = tbFileString+"#10   " +(*it).name +" =" + (*it).test_queue.front()+";\n";
+                        (*it).test_queue.pop();
+                        if((*it).test_queue.empty())
+                            vecQueueIsEmpty = true;
+                    }
+
+                }
             }
         }
+        while(!vecQueueIsEmpty);
     }
-    while(!vecQueueIsEmpty);
     tbFileString = tbFileString + "#10  $finish;\n";
     tbFileString = tbFileString + "end\n";
     tbFileString = tbFileString + "\n\n";
@@ -491,8 +644,27 @@ int main(int argc, char **argv)
 
 
 
-    fprintf (pTBFile,tbFileString.c_str());
-    fclose(pTBFile);
+    //--------------------------------------------------------------
+    // WRITE OUTPUTS (only files whose content changed are touched)
+    //--------------------------------------------------------------
+    int tbStatus = writeFileIfChanged(outFileName.c_str(), tbFileString);
+    if(tbStatus < 0)
+    {
+        printf("Error in export file open\n") ;
+        return 1;
+    }
+    printf("%s %s\n", outFileName.c_str(), tbStatus ? "written" : "unchanged");
+    if(useMemFile) {
+        int memStatus = writeFileIfChanged(memFileName.c_str(), memFileString);
+        if(memStatus < 0)
+        {
+            printf("Error in test vectors file open\n") ;
+            return 1;
+        }
+        printf("%s %s\n", memFileName.c_str(), memStatus ? "written" : "unchanged");
+    }
+    if(writeFileIfChanged(depsFileName.c_str(), manifestToString(curManifest)) < 0)
+        printf("Warning: cannot write dependency manifest %s\n", depsFileName.c_str()) ;
 
     return 0 ; // status OK.
 }
@@ -586,3 +758,101 @@ int getBusSize(Port bus) {
         return ((rightRangeVal-leftRangeVal)+1);
     return 0;
 }
+
+DepFile recordDepFile(std::string kind, std::string path)
+{
+    DepFile dep;
+    dep.kind = kind;
+    dep.path = path;
+    unsigned long long hash;
+    if(getFileStat(path.c_str(), dep.size, dep.mtime) || hashFile(path.c_str(), hash))
+        dep.hash = "-";
+    else
+        dep.hash = hashToHex(hash);
+    if(dep.mtime >= (long long)time(0))
+        dep.mtime = -1;
+    return dep;
+}
+
+int readManifest(std::string fileName, DepManifest &manifest)
+{
+    std::ifstream depsFile(fileName);
+    if (!depsFile.is_open())
+        return 1;
+
+    // Format, one entry per line:
+    //   file <kind> <size> <mtime> <hash> <path>
+    //   clocks <hash>
+    //   options <hash>
+    std::string line="";
+    while (std::getline(depsFile, line)) {
+        if(line.empty() || line[0]=='#')
+            continue;
+        size_t sep = line.find(' ');
+        if(sep == std::string::npos)
+            continue;
+        std::string key = line.substr(0, sep);
+        std::string value = line.substr(sep+1);
+        if(key == "file") {
+            char kind[64];
+            char hash[64];
+            DepFile dep;
+            int pathPos = 0;
+            if(sscanf(value.c_str(), "%63s %lld %lld %63s %n", kind, &dep.size, &dep.mtime, hash, &pathPos) != 4 || !pathPos)
+                return 1;
+            dep.kind = kind;
+            dep.hash = hash;
+            dep.path = value.substr(pathPos);
+            manifest.files.push_back(dep);
+        }
+        else if(key == "clocks")
+            manifest.clocks = value;
+        else if(key == "options")
+            manifest.options = value;
+    }
+    depsFile.close();
+    return 0;
+}
+
+std::string manifestToString(const DepManifest &manifest)
+{
+    std::string str = "# TBAGenerator dependency manifest\n";
+    for (std::vector<DepFile>::const_iterator it = manifest.files.begin() ; it != manifest.files.end(); ++it) {
+        str = str + "file " + (*it).kind + " " + std::to_string((*it).size) + " " + std::to_string((*it).mtime) + " " +
+                (*it).hash + " " + (*it).path + "\n";
+    }
+    str = str + "clocks " + manifest.clocks + "\n";
+    str = str + "options " + manifest.options + "\n";
+    return str;
+}
+
+// True if no recorded input changed. A file whose size or mtime differs is hashed;
+// if the content is still the same its new size/mtime are stored and 'refreshed' is set.
+bool manifestIsUpToDate(DepManifest &manifest, bool &refreshed)
+{
+    if(manifest.files.empty())
+        return false;
+    for (std::vector<DepFile>::iterator it = manifest.files.begin() ; it != manifest.files.end(); ++it) {
+        long long size, mtime;
+        if(getFileStat((*it).path.c_str(), size, mtime))
+            return false;
+        if(size == (*it).size && mtime == (*it).mtime)
+            continue;
+        unsigned long long hash;
+        if(hashFile((*it).path.c_str(), hash) || hashToHex(hash) != (*it).hash)
+            return false;
+        (*it).size = size;
+        (*it).mtime = (mtime >= (long long)time(0)) ? -1 : mtime;
+        refreshed = true;
+    }
+    return true;
+}
+
+std::string replaceExtension(std::string fileName, std::string ext)
+{
+    size_t dot = fileName.find_last_of('.');
+    size_t sep = fileName.find_last_of("/\\");
+    if(dot == std::string::npos || (sep != std::string::npos && dot < sep))
+        return fileName + ext;
+    return fileName.substr(0, dot) + ext;
+}
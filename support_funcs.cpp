@@ -1,6 +1,7 @@
 #include "support_funcs.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/stat.h>
 
 char *trimWhiteSpace(char *str)
 {
@@ -50,3 +51,82 @@ std::vector<char *> splitString(const char * str, char *key)
     return resVec;
 }
 
+
+// 64-bit FNV-1a, good enough to detect changed inputs between two runs
+#define FNV_OFFSET_BASIS 14695981039346656037ULL
+#define FNV_PRIME        1099511628211ULL
+
+static unsigned long long hashBytes(unsigned long long hash, const char *buf, size_t len)
+{
+    for(size_t i=0;i<len;++i) {
+        hash ^= (unsigned char)buf[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+unsigned long long hashString(const std::string &str)
+{
+    return hashBytes(FNV_OFFSET_BASIS, str.data(), str.size());
+}
+
+int hashFile(const char *fileName, unsigned long long &hash)
+{
+    hash = FNV_OFFSET_BASIS;
+    FILE *pFile = fopen(fileName,"rb");
+    if(!pFile)
+        return 1;
+    char buf[65536];
+    size_t len;
+    while((len = fread(buf,1,sizeof(buf),pFile)) > 0)
+        hash = hashBytes(hash, buf, len);
+    fclose(pFile);
+    return 0;
+}
+
+int getFileStat(const char *fileName, long long &size, long long &mtime)
+{
+    struct stat st;
+    if(stat(fileName, &st))
+        return 1;
+    size = (long long)st.st_size;
+    mtime = (long long)st.st_mtime;
+    return 0;
+}
+
+int readFileToString(const char *fileName, std::string &content)
+{
+    content.clear();
+    FILE *pFile = fopen(fileName,"rb");
+    if(!pFile)
+        return 1;
+    char buf[65536];
+    size_t len;
+    while((len = fread(buf,1,sizeof(buf),pFile)) > 0)
+        content.append(buf, len);
+    fclose(pFile);
+    return 0;
+}
+
+// Returns 0 if the file already holds 'content' (it is not touched, so its
+// mtime is preserved), 1 if it was (re)written and -1 on write error.
+int writeFileIfChanged(const char *fileName, const std::string &content)
+{
+    std::string oldContent;
+    if(!readFileToString(fileName, oldContent) && oldContent == content)
+        return 0;
+    FILE *pFile = fopen(fileName,"wb");
+    if(!pFile)
+        return -1;
+    size_t written = fwrite(content.data(),1,content.size(),pFile);
+    if(fclose(pFile) || written != content.size())
+        return -1;
+    return 1;
+}
+
+std::string hashToHex(unsigned long long hash)
+{
+    char buf[17];
+    snprintf(buf, sizeof(buf), "%016llx", hash);
+    return std::string(buf);
+}
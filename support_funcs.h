@@ -1,10 +1,18 @@
-#include <cstdio>
-#include <cstdlib>
-#include <ctype.h>
-#include <cstring>
-#include <string.h>
-#include <vector>
-
-char *trimWhiteSpace(char *str);
-int startsWith(const char *pre, const char *str);
-std::vector<char *> splitString(const char *str, char *key);
+#include <cstdio>
+#include <cstdlib>
+#include <ctype.h>
+#include <cstring>
+#include <string.h>
+#include <vector>
+#include <string>
+
+char *trimWhiteSpace(char *str);
+int startsWith(const char *pre, const char *str);
+std::vector<char *> splitString(const char *str, char *key);
+
+unsigned long long hashString(const std::string &str);
+int hashFile(const char *fileName, unsigned long long &hash);
+int getFileStat(const char *fileName, long long &size, long long &mtime);
+int readFileToString(const char *fileName, std::string &content);
+int writeFileIfChanged(const char *fileName, const std::string &content);
+std::string hashToHex(unsigned long long hash);